@@ -2,16 +2,22 @@
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <set>
 #include <vector>
 #include <cctype>
 #include <string>
 #include <stdexcept>
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
 
 using namespace std;
 
 // Token Types
 enum class TokenType {
     TOKEN_INT,
+    TOKEN_BOOL,
+    TOKEN_STRUCT,
     TOKEN_IDENTIFIER,
     TOKEN_NUMBER,
     TOKEN_ASSIGN,
@@ -25,6 +31,10 @@ enum class TokenType {
     TOKEN_RBRACE,
     TOKEN_NOT_EQUAL,
     TOKEN_SEMICOLON,
+    TOKEN_COMMA,
+    TOKEN_DOT,
+    TOKEN_ASM,
+    TOKEN_STRING,
     TOKEN_UNKNOWN,
     TOKEN_EOF
 };
@@ -39,18 +49,23 @@ public:
 };
 
 // Lexer Class
+// Reads the source straight from its stream buffer, so the compiler never
+// holds more of the input than the token being built.
 class Lexer {
 private:
-    string input;
-    size_t position;
-    
+    streambuf* input;
+
+    bool atEnd() const {
+        return input->sgetc() == char_traits<char>::eof();
+    }
+
     char currentChar() const {
-        if (position >= input.length()) return '\0';
-        return input[position];
+        if (atEnd()) return '\0';
+        return char_traits<char>::to_char_type(input->sgetc());
     }
     
     void advance() {
-        position++;
+        input->sbumpc();
     }
     
     void skipWhitespace() {
@@ -60,24 +75,27 @@ private:
     }
 
 public:
-    explicit Lexer(const string& input) : input(input), position(0) {}
+    explicit Lexer(streambuf* input = nullptr) : input(input) {}
 
     Token getNextToken() {
         skipWhitespace();
         
-        if (position >= input.length()) {
+        if (atEnd()) {
             return Token(TokenType::TOKEN_EOF, "");
         }
 
-        if (isalpha(currentChar())) {
+        if (isalpha(currentChar()) || currentChar() == '_') {
             string text;
-            while (isalnum(currentChar())) {
+            while (isalnum(currentChar()) || currentChar() == '_') {
                 text += currentChar();
                 advance();
             }
             
             if (text == "int") return Token(TokenType::TOKEN_INT, text);
+            if (text == "bool") return Token(TokenType::TOKEN_BOOL, text);
+            if (text == "struct") return Token(TokenType::TOKEN_STRUCT, text);
             if (text == "if") return Token(TokenType::TOKEN_IF, text);
+            if (text == "asm") return Token(TokenType::TOKEN_ASM, text);
             return Token(TokenType::TOKEN_IDENTIFIER, text);
         }
 
@@ -90,6 +108,21 @@ public:
             return Token(TokenType::TOKEN_NUMBER, number);
         }
 
+        if (currentChar() == '"') {
+            advance();
+            string text;
+            while (!atEnd() && currentChar() != '"' &&
+                   currentChar() != '\n') {
+                text += currentChar();
+                advance();
+            }
+            if (currentChar() != '"') {
+                return Token(TokenType::TOKEN_UNKNOWN, "\"" + text);
+            }
+            advance();
+            return Token(TokenType::TOKEN_STRING, text);
+        }
+
         char c = currentChar();
         advance();
         
@@ -107,6 +140,8 @@ public:
             case '{': return Token(TokenType::TOKEN_LBRACE, "{");
             case '}': return Token(TokenType::TOKEN_RBRACE, "}");
             case ';': return Token(TokenType::TOKEN_SEMICOLON, ";");
+            case ',': return Token(TokenType::TOKEN_COMMA, ",");
+            case '.': return Token(TokenType::TOKEN_DOT, ".");
         }
 
         return Token(TokenType::TOKEN_UNKNOWN, string(1, c));
@@ -123,6 +158,17 @@ public:
 class Expression : public ASTNode {
 public:
     virtual ~Expression() = default;
+
+    // Stores the value and returns true if the expression is a
+    // compile-time constant.
+    virtual bool constantValue(int&) const {
+        return false;
+    }
+
+    // True if evaluating the expression changes the condition flags.
+    virtual bool setsFlags() const {
+        return false;
+    }
 };
 
 class Statement : public ASTNode {
@@ -130,15 +176,111 @@ public:
     virtual ~Statement() = default;
 };
 
+// Text for a section written after the code (.data, .bss, flag bytes).
+// Past the memory budget it moves to an anonymous temporary file, so a
+// large program's sections are not held in memory until the postlude.
+class SectionBuffer {
+private:
+    string buffer;
+    size_t memoryBudget;
+    FILE* file = nullptr;
+    size_t size = 0;
+
+public:
+    explicit SectionBuffer(size_t memoryBudget) : memoryBudget(memoryBudget) {}
+    SectionBuffer(const SectionBuffer&) = delete;
+    SectionBuffer& operator=(const SectionBuffer&) = delete;
+
+    ~SectionBuffer() {
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    void append(const string& text) {
+        buffer += text;
+        size += text.length();
+        if (buffer.length() >= memoryBudget) {
+            spill();
+        }
+    }
+
+    size_t getSize() const { return size; }
+
+    void writeTo(ostream& out) {
+        if (file) {
+            spill();
+            rewind(file);
+            char chunk[4096];
+            size_t count;
+            while ((count = fread(chunk, 1, sizeof chunk, file)) > 0) {
+                out.write(chunk, count);
+            }
+            if (ferror(file)) {
+                throw runtime_error("Cannot read back spilled section");
+            }
+        } else {
+            out << buffer;
+        }
+    }
+
+private:
+    void spill() {
+        if (!file && !(file = tmpfile())) {
+            throw runtime_error("Cannot create a temporary file for spilling");
+        }
+        if (fwrite(buffer.data(), 1, buffer.length(), file) != buffer.length()) {
+            throw runtime_error("Cannot spill section to a temporary file");
+        }
+        string().swap(buffer);
+    }
+};
+
 // CodeGenerator Class
 class CodeGenerator {
 private:
     int registerCount = 0;
     int labelCount = 0;
     stringstream assemblyCode;
-    map<string, string> variables;
+    SectionBuffer dataSection;
+    SectionBuffer bssSection;
+    SectionBuffer flagSection;
+    // A variable's storage; bool flags are packed eight to a byte and
+    // record their bit within it. Struct fields name their Type.field so
+    // accesses can be counted for layout.
+    struct Variable {
+        string location;
+        int bit;
+        string field;
+    };
+    map<string, Variable> variables;
+    int flagCount = 0;
+    // Struct types as (type, name) field lists in declaration order, and
+    // struct variables with their type, laid out once all uses are known.
+    map<string, vector<pair<string, string>>> structTypes;
+    vector<pair<string, string>> structVariables;
+    map<string, string> structVariableTypes;
+    map<string, int> fieldAccesses;
+    int conditionalDepth = 0;
+    // Registers already holding a constant, so a run of stores of the same
+    // value (a fill) loads it only once. Each enclosing conditional saves
+    // the outer set, since values loaded in a skipped body don't survive
+    // the join.
+    map<int, string> constantRegisters;
+    vector<map<int, string>> savedConstantRegisters;
+    ostream* spill = nullptr;
+    size_t memoryBudget = 0;
+    size_t bytesEmitted = 0;
+    size_t peakBuffered = 0;
+    size_t spillCount = 0;
 
 public:
+    // Buffered code beyond memoryBudget bytes is spilled to the given
+    // stream; each data section spills to its own temporary file.
+    CodeGenerator(ostream& spill, size_t memoryBudget)
+        : dataSection(memoryBudget), bssSection(memoryBudget), flagSection(memoryBudget),
+          spill(&spill), memoryBudget(memoryBudget) {}
+
     string getNewRegister() {
         return "R" + to_string(registerCount++);
     }
@@ -147,32 +289,349 @@ public:
         return "L" + to_string(labelCount++);
     }
 
-    void emit(const string& code) {
-        assemblyCode << code << "\n";
+    void emit(const string& code, bool newline = true) {
+        assemblyCode << code;
+        if (newline) {
+            assemblyCode << "\n";
+        }
+        bytesEmitted += code.length() + (newline ? 1 : 0);
+        size_t buffered = static_cast<size_t>(assemblyCode.tellp());
+        if (buffered > peakBuffered) {
+            peakBuffered = buffered;
+        }
+        if (spill && buffered >= memoryBudget) {
+            flush();
+            spillCount++;
+        }
+    }
+
+    void flush() {
+        if (spill && assemblyCode.tellp() > 0) {
+            writeTo(*spill);
+            assemblyCode.str("");
+            assemblyCode.clear();
+        }
     }
 
-    void declareVariable(const string& name) {
-        if (variables.find(name) == variables.end()) {
-            variables[name] = name;
-            emit(name + ": .word 0");
+    size_t getBytesEmitted() const { return bytesEmitted; }
+    size_t getPeakBuffered() const { return peakBuffered; }
+    size_t getSpillCount() const { return spillCount; }
+
+    // Zero-initialised variables live in .bss and are cleared at startup.
+    void declareVariable(const string& name, const string& type = "int") {
+        auto it = variables.lower_bound(name);
+        if ((it != variables.end() && it->first == name) ||
+            structVariableTypes.find(name) != structVariableTypes.end()) {
+            return;
+        }
+        if (structTypes.find(type) != structTypes.end()) {
+            declareStructVariable(name, type);
+        } else {
+            addVariable(it, name, type);
         }
     }
 
-    string getVariableLocation(const string& name) {
-        if (variables.find(name) == variables.end()) {
-            declareVariable(name);
+    // Places a first declaration with a constant initialiser straight into
+    // the image. Returns false if the store must still happen at runtime:
+    // the variable already exists, the declaration sits in conditional
+    // code, or it sets a packed flag.
+    bool declareInitializedVariable(const string& name, const string& type, int value) {
+        if (conditionalDepth > 0 || (type == "bool" && value != 0)) {
+            return false;
+        }
+        auto it = variables.lower_bound(name);
+        if ((it != variables.end() && it->first == name) ||
+            structVariableTypes.find(name) != structVariableTypes.end()) {
+            return false;
+        }
+        if (value == 0) {
+            addVariable(it, name, type);
+        } else {
+            variables.emplace_hint(it, name, Variable{name, -1, ""});
+            dataSection.append(name + ": .word " + to_string(value) + "\n");
         }
-        return variables[name];
+        return true;
     }
 
-    void generatePrelude() {
-        emit(".section .data");
+    // Single lookup: a use of an undeclared name declares it on the spot.
+    const Variable& getVariable(const string& name) {
+        auto it = variables.lower_bound(name);
+        if (it != variables.end() && it->first == name) {
+            return it->second;
+        }
+        if (structVariableTypes.find(name) != structVariableTypes.end()) {
+            throw runtime_error("Struct '" + name + "' cannot be used as a value");
+        }
+        if (name.find('.') != string::npos) {
+            throw runtime_error("Unknown field '" + name + "'");
+        }
+        return addVariable(it, name, "int")->second;
     }
 
-    void generatePostlude() {
+    // Inserts a new int or bool at the position lower_bound() found for
+    // it, so declaring costs no second walk of the symbol map.
+    map<string, Variable>::iterator addVariable(map<string, Variable>::iterator hint,
+                                                const string& name, const string& type) {
+        if (type == "bool") {
+            string byte = "__flags" + to_string(flagCount / 8);
+            if (flagCount % 8 == 0) {
+                flagSection.append(byte + ": .space 1\n");
+            }
+            int bit = flagCount++ % 8;
+            return variables.emplace_hint(hint, name, Variable{byte, bit, ""});
+        }
+        bssSection.append(name + ": .space 4\n");
+        return variables.emplace_hint(hint, name, Variable{name, -1, ""});
+    }
+
+    void declareStruct(const string& name, const vector<pair<string, string>>& fields) {
+        if (!structTypes.emplace(name, fields).second) {
+            throw runtime_error("Struct '" + name + "' redefined");
+        }
+    }
+
+    // Each field becomes a variable at symbol name.field, which the
+    // postlude binds to an absolute address inside name's block. Bool
+    // fields are packed into the block's own flag bytes.
+    void declareStructVariable(const string& name, const string& type) {
+        structVariables.emplace_back(name, type);
+        structVariableTypes[name] = type;
+        int flags = 0;
+        for (const auto& field : structTypes[type]) {
+            string key = type + "." + field.second;
+            if (field.first == "bool") {
+                string byte = name + ".__flags" + to_string(flags / 8);
+                variables[name + "." + field.second] = Variable{byte, flags % 8, key};
+                flags++;
+            } else {
+                string location = name + "." + field.second;
+                variables[location] = Variable{location, -1, key};
+            }
+        }
+    }
+
+    // Orders a struct's int fields hottest first, so the most used get
+    // the smallest offsets, then packs its bool fields into trailing
+    // bytes. Returns each field symbol's offset and the padded size.
+    map<string, int> layoutStruct(const string& type, int& size) {
+        vector<string> words;
+        int flags = 0;
+        for (const auto& field : structTypes[type]) {
+            if (field.first == "bool") {
+                flags++;
+            } else {
+                words.push_back(field.second);
+            }
+        }
+        stable_sort(words.begin(), words.end(), [&](const string& a, const string& b) {
+            return fieldAccesses[type + "." + a] > fieldAccesses[type + "." + b];
+        });
+
+        map<string, int> offsets;
+        int offset = 0;
+        for (const auto& field : words) {
+            offsets[field] = offset;
+            offset += 4;
+        }
+        for (int byte = 0; byte * 8 < flags; byte++) {
+            offsets["__flags" + to_string(byte)] = offset++;
+        }
+        size = (offset + 3) / 4 * 4;
+        return offsets;
+    }
+
+    void countAccess(const Variable& var) {
+        if (!var.field.empty()) {
+            fieldAccesses[var.field]++;
+        }
+    }
+
+    const string& getVariableLocation(const string& name) {
+        return getVariable(name).location;
+    }
+
+    // Location for an access emitted outside the load/store helpers, such
+    // as an asm operand; counted like any other access for struct layout.
+    const string& accessVariableLocation(const string& name) {
+        const Variable& var = getVariable(name);
+        countAccess(var);
+        return var.location;
+    }
+
+    bool isFlag(const string& name) {
+        return getVariable(name).bit >= 0;
+    }
+
+    // Loads a variable's value into a register; flags read as 0 or 1.
+    string loadVariable(const string& name) {
+        const Variable& var = getVariable(name);
+        countAccess(var);
+        string reg = getNewRegister();
+        if (var.bit < 0) {
+            emit("LDR " + reg + ", [" + var.location + "]");
+            return reg;
+        }
+        emit("LDRB " + reg + ", [" + var.location + "]");
+        string bitReg = getNewRegister();
+        emit("AND " + bitReg + ", " + reg + ", #" + to_string(1 << var.bit));
+        if (var.bit == 0) {
+            return bitReg;
+        }
+        string result = getNewRegister();
+        emit("LSR " + result + ", " + bitReg + ", #" + to_string(var.bit));
+        return result;
+    }
+
+    // Evaluates value and stores it; a flag is set if the value is non-zero.
+    void storeVariable(const string& name, Expression* value) {
+        const Variable& var = getVariable(name);
+        countAccess(var);
+        if (var.bit < 0) {
+            string valueReg = value->generateAssembly(*this);
+            emit("STR " + valueReg + ", [" + var.location + "]");
+            return;
+        }
+
+        string mask = "#" + to_string(1 << var.bit);
+        int constant;
+        string byteReg;
+        if (value->constantValue(constant)) {
+            byteReg = getNewRegister();
+            emit("LDRB " + byteReg + ", [" + var.location + "]");
+            emit((constant ? "ORR " : "BIC ") + byteReg + ", " + byteReg + ", " + mask);
+        } else {
+            string valueReg = value->generateAssembly(*this);
+            byteReg = getNewRegister();
+            emit("CMP " + valueReg + ", #0");
+            emit("LDRB " + byteReg + ", [" + var.location + "]");
+            emit("ORRNE " + byteReg + ", " + byteReg + ", " + mask);
+            emit("BICEQ " + byteReg + ", " + byteReg + ", " + mask);
+        }
+        emit("STRB " + byteReg + ", [" + var.location + "]");
+    }
+
+    // Tests a flag in place; the Z flag is clear when it is set.
+    void generateFlagTest(const string& name) {
+        const Variable& var = getVariable(name);
+        countAccess(var);
+        string reg = getNewRegister();
+        emit("LDRB " + reg + ", [" + var.location + "]");
+        emit("TST " + reg + ", #" + to_string(1 << var.bit));
+    }
+
+    // True if value is an ARM modified immediate: an 8-bit constant
+    // rotated right by an even amount.
+    static bool isModifiedImmediate(unsigned value) {
+        for (unsigned rotate = 0; rotate < 32; rotate += 2) {
+            if (((value << rotate) | (value >> ((32 - rotate) & 31))) <= 0xFF) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Immediate operand for ADD/SUB/CMP-style instructions, or "" if the
+    // constant must be loaded into a register. The assembler also takes a
+    // negated immediate by switching ADD/SUB or CMP/CMN.
+    static string arithmeticImmediate(int value) {
+        unsigned bits = static_cast<unsigned>(value);
+        if (isModifiedImmediate(bits) || isModifiedImmediate(0u - bits)) {
+            return "#" + to_string(value);
+        }
+        return "";
+    }
+
+    // MOV takes a modified immediate, its complement (assembled as MVN) or
+    // a 16-bit value (MOVW); anything else comes from the literal pool.
+    string getConstantRegister(int value) {
+        auto it = constantRegisters.find(value);
+        if (it != constantRegisters.end()) {
+            return it->second;
+        }
+        string reg = getNewRegister();
+        unsigned bits = static_cast<unsigned>(value);
+        if (isModifiedImmediate(bits) || isModifiedImmediate(~bits) || bits <= 0xFFFF) {
+            emit("MOV " + reg + ", #" + to_string(value));
+        } else {
+            emit("LDR " + reg + ", =" + to_string(value));
+        }
+        constantRegisters[value] = reg;
+        return reg;
+    }
+
+    // Forgets every cached constant, for code that may overwrite registers.
+    // The outer sets are cleared too, or leaving an enclosing conditional
+    // would restore registers the code has since overwritten.
+    void invalidateConstantRegisters() {
+        constantRegisters.clear();
+        for (auto& saved : savedConstantRegisters) {
+            saved.clear();
+        }
+    }
+
+    void enterConditional() {
+        conditionalDepth++;
+        savedConstantRegisters.push_back(constantRegisters);
+    }
+
+    void leaveConditional() {
+        conditionalDepth--;
+        constantRegisters = savedConstantRegisters.back();
+        savedConstantRegisters.pop_back();
+    }
+
+    // Entry point and startup code clearing .bss a word at a time.
+    void generatePrelude() {
         emit(".section .text");
         emit(".global _start");
         emit("_start:");
+        emit("LDR R0, =__bss_start");
+        emit("LDR R1, =__bss_end");
+        emit("MOV R2, #0");
+        emit("__bss_clear:");
+        emit("CMP R0, R1");
+        emit("STRLO R2, [R0], #4");
+        emit("BLO __bss_clear");
+    }
+
+    // Data sections, emitted once every variable has been seen.
+    void generatePostlude() {
+        emit(".section .data");
+        emitSection(dataSection);
+        emit(".section .bss");
+        emit("__bss_start:");
+        emitSection(bssSection);
+
+        // Struct blocks, with every field bound to an absolute address
+        map<string, pair<map<string, int>, int>> layouts;
+        for (const auto& structVar : structVariables) {
+            auto layout = layouts.find(structVar.second);
+            if (layout == layouts.end()) {
+                int size;
+                map<string, int> offsets = layoutStruct(structVar.second, size);
+                layout = layouts.emplace(structVar.second, make_pair(offsets, size)).first;
+            }
+            emit(structVar.first + ": .space " + to_string(layout->second.second));
+            for (const auto& field : layout->second.first) {
+                emit(".equ " + structVar.first + "." + field.first + ", " +
+                     structVar.first + " + " + to_string(field.second));
+            }
+        }
+
+        if (flagCount > 0) {
+            // Flag bytes are padded out so the word-wise clear stays in bounds
+            emitSection(flagSection);
+            emit(".balign 4");
+        }
+        emit("__bss_end:");
+    }
+
+    // Sections are copied straight through to the output after what is
+    // already buffered, rather than re-buffered by emit().
+    void emitSection(SectionBuffer& section) {
+        flush();
+        section.writeTo(spill ? *spill : assemblyCode);
+        bytesEmitted += section.getSize();
     }
 
     void generateEpilogue() {
@@ -184,6 +643,14 @@ public:
     string getCurrentCode() const {
         return assemblyCode.str();
     }
+
+    // Streams the generated code out without materialising a second copy.
+    void writeTo(ostream& out) {
+        // Inserting an empty streambuf would set failbit on out
+        if (assemblyCode.tellp() > 0) {
+            out << assemblyCode.rdbuf();
+        }
+    }
 };
 
 // AST Node implementations
@@ -191,11 +658,14 @@ class Number : public Expression {
 public:
     int value;
     explicit Number(int value) : value(value) {}
+
+    bool constantValue(int& result) const override {
+        result = value;
+        return true;
+    }
     
     string generateAssembly(CodeGenerator& generator) override {
-        string reg = generator.getNewRegister();
-        generator.emit("MOV " + reg + ", #" + to_string(value));
-        return reg;
+        return generator.getConstantRegister(value);
     }
 };
 
@@ -205,10 +675,7 @@ public:
     explicit Identifier(string name) : name(name) {}
     
     string generateAssembly(CodeGenerator& generator) override {
-        string reg = generator.getNewRegister();
-        string location = generator.getVariableLocation(name);
-        generator.emit("LDR " + reg + ", [" + location + "]");
-        return reg;
+        return generator.loadVariable(name);
     }
 };
 
@@ -220,23 +687,225 @@ public:
     
     BinaryOp(string op, Expression* left, Expression* right)
         : op(op), left(left), right(right) {}
+
+    ~BinaryOp() override {
+        delete left;
+        delete right;
+    }
+
+    bool setsFlags() const override {
+        int value;
+        if (constantValue(value)) {
+            return false;
+        }
+        return op == "==" || left->setsFlags() || right->setsFlags();
+    }
+
+    // Folds with the target's wrap-around arithmetic.
+    bool constantValue(int& result) const override {
+        int leftValue, rightValue;
+        if (!left->constantValue(leftValue) || !right->constantValue(rightValue)) {
+            return false;
+        }
+        unsigned leftBits = static_cast<unsigned>(leftValue);
+        unsigned rightBits = static_cast<unsigned>(rightValue);
+        if (op == "+") {
+            result = static_cast<int>(leftBits + rightBits);
+        } else if (op == "-") {
+            result = static_cast<int>(leftBits - rightBits);
+        } else if (op == "==") {
+            result = leftValue == rightValue;
+        } else {
+            return false;
+        }
+        return true;
+    }
     
     string generateAssembly(CodeGenerator& generator) override {
-        string leftReg = left->generateAssembly(generator);
-        string rightReg = right->generateAssembly(generator);
+        int value;
+        if (constantValue(value)) {
+            return generator.getConstantRegister(value);
+        }
+
+        string leftReg, rightOperand;
+        generateOperands(generator, leftReg, rightOperand);
         string resultReg = generator.getNewRegister();
         
         if (op == "+") {
-            generator.emit("ADD " + resultReg + ", " + leftReg + ", " + rightReg);
+            generator.emit("ADD " + resultReg + ", " + leftReg + ", " + rightOperand);
         } else if (op == "-") {
-            generator.emit("SUB " + resultReg + ", " + leftReg + ", " + rightReg);
+            generator.emit("SUB " + resultReg + ", " + leftReg + ", " + rightOperand);
         } else if (op == "==") {
-            generator.emit("CMP " + leftReg + ", " + rightReg);
+            generator.emit("CMP " + leftReg + ", " + rightOperand);
             generator.emit("MOV " + resultReg + ", #0");
             generator.emit("MOVEQ " + resultReg + ", #1");
         }
         return resultReg;
     }
+
+    // A constant second operand that the target can encode is used as an
+    // immediate instead of being loaded with its own MOV. For commutative
+    // operators a constant left operand is swapped into that position.
+    void generateOperands(CodeGenerator& generator, string& leftReg, string& rightOperand) {
+        Expression* first = left;
+        Expression* second = right;
+        int value;
+        if (op != "-" && left->constantValue(value) && !right->constantValue(value)) {
+            swap(first, second);
+        }
+        leftReg = first->generateAssembly(generator);
+        rightOperand = "";
+        if (second->constantValue(value)) {
+            rightOperand = CodeGenerator::arithmeticImmediate(value);
+        }
+        if (rightOperand.empty()) {
+            rightOperand = second->generateAssembly(generator);
+        }
+    }
+};
+
+// Builtin intrinsic calls, each lowered to a single target instruction.
+// Bit indices must be constants so they encode as immediate masks.
+class Intrinsic : public Expression {
+public:
+    string name;
+    vector<Expression*> args;
+
+    Intrinsic(string name, vector<Expression*> args) : name(name), args(args) {}
+
+    ~Intrinsic() override {
+        for (auto arg : args) {
+            delete arg;
+        }
+    }
+
+    // Number of arguments taken by each intrinsic, or -1 if the name is
+    // not an intrinsic.
+    static int arity(const string& name) {
+        static const map<string, int> intrinsics = {
+            {"__adds", 2},   // add, setting the carry flag
+            {"__adc", 2},    // add with the carry left by the previous __adds
+            {"__ror", 2},    // rotate right
+            {"__rol", 2},    // rotate left
+            {"__bitset", 2}, // set bit n
+            {"__bitclr", 2}, // clear bit n
+            {"__bittst", 2}, // 1 if bit n is set, else 0
+        };
+        auto it = intrinsics.find(name);
+        return it == intrinsics.end() ? -1 : it->second;
+    }
+
+    bool setsFlags() const override {
+        int value;
+        if (constantValue(value)) {
+            return false;
+        }
+        return name == "__adds" || name == "__bittst" ||
+               args[0]->setsFlags() || args[1]->setsFlags();
+    }
+
+    // The carry intrinsics depend on flags and never fold.
+    bool constantValue(int& result) const override {
+        int x, n;
+        if (name == "__adds" || name == "__adc" ||
+            !args[0]->constantValue(x) || !args[1]->constantValue(n)) {
+            return false;
+        }
+        unsigned value = static_cast<unsigned>(x);
+        unsigned shift = static_cast<unsigned>(n) & 31;
+        if (name == "__ror") {
+            value = (value >> shift) | (value << ((32 - shift) & 31));
+        } else if (name == "__rol") {
+            value = (value << shift) | (value >> ((32 - shift) & 31));
+        } else if (name == "__bitset") {
+            value |= 1u << shift;
+        } else if (name == "__bitclr") {
+            value &= ~(1u << shift);
+        } else {
+            value = (value >> shift) & 1;
+        }
+        result = static_cast<int>(value);
+        return true;
+    }
+
+    string generateAssembly(CodeGenerator& generator) override {
+        int value;
+        if (constantValue(value)) {
+            return generator.getConstantRegister(value);
+        }
+
+        if (name == "__bittst") {
+            generateBitTest(generator);
+            string resultReg = generator.getNewRegister();
+            generator.emit("MOV " + resultReg + ", #0");
+            generator.emit("MOVNE " + resultReg + ", #1");
+            return resultReg;
+        }
+
+        string xReg = args[0]->generateAssembly(generator);
+        string resultReg;
+        if (name == "__adds" || name == "__adc") {
+            string operand = generateOperand(generator, args[1]);
+            resultReg = generator.getNewRegister();
+            string opcode = name == "__adds" ? "ADDS " : "ADC ";
+            generator.emit(opcode + resultReg + ", " + xReg + ", " + operand);
+        } else if (name == "__ror" || name == "__rol") {
+            int n;
+            string amount;
+            if (args[1]->constantValue(n)) {
+                n &= 31;
+                amount = "#" + to_string(name == "__rol" ? (32 - n) & 31 : n);
+            } else {
+                amount = args[1]->generateAssembly(generator);
+                if (name == "__rol") {
+                    string negated = generator.getNewRegister();
+                    generator.emit("RSB " + negated + ", " + amount + ", #32");
+                    amount = negated;
+                }
+            }
+            resultReg = generator.getNewRegister();
+            generator.emit("ROR " + resultReg + ", " + xReg + ", " + amount);
+        } else {
+            string opcode = name == "__bitset" ? "ORR " : "BIC ";
+            resultReg = generator.getNewRegister();
+            generator.emit(opcode + resultReg + ", " + xReg + ", " + bitMask());
+        }
+        return resultReg;
+    }
+
+    // Emits TST for __bittst; the Z flag is clear when the bit is set.
+    void generateBitTest(CodeGenerator& generator) {
+        string xReg = args[0]->generateAssembly(generator);
+        generator.emit("TST " + xReg + ", " + bitMask());
+    }
+
+private:
+    string bitMask() const {
+        int n;
+        if (!args[1]->constantValue(n)) {
+            throw runtime_error("Bit index of " + name + " must be a constant");
+        }
+        return "#" + to_string(1u << (static_cast<unsigned>(n) & 31));
+    }
+
+    // ADDS takes the same immediates as ADD. ADC's assembler alias is SBC
+    // with the inverted value rather than the negated one.
+    string generateOperand(CodeGenerator& generator, Expression* arg) const {
+        int value;
+        if (arg->constantValue(value)) {
+            unsigned bits = static_cast<unsigned>(value);
+            if (name == "__adds") {
+                string immediate = CodeGenerator::arithmeticImmediate(value);
+                if (!immediate.empty()) {
+                    return immediate;
+                }
+            } else if (CodeGenerator::isModifiedImmediate(bits) ||
+                       CodeGenerator::isModifiedImmediate(~bits)) {
+                return "#" + to_string(value);
+            }
+        }
+        return arg->generateAssembly(generator);
+    }
 };
 
 class Assignment : public Statement {
@@ -246,11 +915,13 @@ public:
     
     Assignment(string identifier, Expression* exp)
         : identifier(identifier), exp(exp) {}
+
+    ~Assignment() override {
+        delete exp;
+    }
     
     string generateAssembly(CodeGenerator& generator) override {
-        string valueReg = exp->generateAssembly(generator);
-        string location = generator.getVariableLocation(identifier);
-        generator.emit("STR " + valueReg + ", [" + location + "]");
+        generator.storeVariable(identifier, exp);
         return "";
     }
 };
@@ -263,21 +934,48 @@ public:
     
     VarDeclaration(string type, string name, Expression* init)
         : type(type), name(name), initializer(init) {}
+
+    ~VarDeclaration() override {
+        delete initializer;
+    }
     
     string generateAssembly(CodeGenerator& generator) override {
-        generator.declareVariable(name);
+        int value;
+        if (initializer && initializer->constantValue(value) &&
+            generator.declareInitializedVariable(name, type, value)) {
+            return "";
+        }
+        generator.declareVariable(name, type);
         if (initializer) {
-            string valueReg = initializer->generateAssembly(generator);
-            string location = generator.getVariableLocation(name);
-            generator.emit("STR " + valueReg + ", [" + location + "]");
+            generator.storeVariable(name, initializer);
         }
         return "";
     }
 };
 
+class StructDeclaration : public Statement {
+public:
+    string name;
+    vector<pair<string, string>> fields;
+
+    StructDeclaration(string name, vector<pair<string, string>> fields)
+        : name(name), fields(fields) {}
+
+    string generateAssembly(CodeGenerator& generator) override {
+        generator.declareStruct(name, fields);
+        return "";
+    }
+};
+
 class Block : public Statement {
 public:
     vector<Statement*> statements;
+
+    ~Block() override {
+        for (auto stmt : statements) {
+            delete stmt;
+        }
+    }
     
     void addStatement(Statement* stmt) {
         statements.push_back(stmt);
@@ -298,35 +996,214 @@ public:
     
     If(Expression* condition, Statement* thenBranch)
         : condition(condition), thenBranch(thenBranch) {}
+
+    ~If() override {
+        delete condition;
+        delete thenBranch;
+    }
     
     string generateAssembly(CodeGenerator& generator) override {
-        string condReg = condition->generateAssembly(generator);
-        string endLabel = generator.getNewLabel();
+        string endLabel;
         
-        generator.emit("CMP " + condReg + ", #1");
-        generator.emit("BNE " + endLabel);
+        // Equality and bit-test conditions branch straight off their own
+        // compare instead of materialising a 0/1 result and testing that.
+        BinaryOp* compare = dynamic_cast<BinaryOp*>(condition);
+        Intrinsic* bitTest = dynamic_cast<Intrinsic*>(condition);
+        Identifier* flag = dynamic_cast<Identifier*>(condition);
+        if (compare && compare->op == "==") {
+            string leftReg, rightOperand;
+            compare->generateOperands(generator, leftReg, rightOperand);
+            endLabel = generator.getNewLabel();
+            generator.emit("CMP " + leftReg + ", " + rightOperand);
+            generator.emit("BNE " + endLabel);
+        } else if (bitTest && bitTest->name == "__bittst") {
+            bitTest->generateBitTest(generator);
+            endLabel = generator.getNewLabel();
+            generator.emit("BEQ " + endLabel);
+        } else if (flag && generator.isFlag(flag->name)) {
+            generator.generateFlagTest(flag->name);
+            endLabel = generator.getNewLabel();
+            generator.emit("BEQ " + endLabel);
+        } else {
+            string condReg = condition->generateAssembly(generator);
+            endLabel = generator.getNewLabel();
+            generator.emit("CMP " + condReg + ", #1");
+            generator.emit("BNE " + endLabel);
+        }
         
+        generator.enterConditional();
         thenBranch->generateAssembly(generator);
+        generator.leaveConditional();
         
         generator.emit(endLabel + ":");
         return "";
     }
 };
 
+// Inline assembly: the lines are spliced in verbatim after substituting
+// {name} with the register bound to each declared operand; any other
+// braces, such as register lists, are left alone. Inputs are
+// loaded before the block and outputs stored after it; operand registers
+// are never allocated from the clobber list.
+class InlineAsm : public Statement {
+public:
+    vector<string> inputs;
+    vector<string> outputs;
+    vector<string> clobbers;
+    vector<string> lines;
+
+    InlineAsm(vector<string> inputs, vector<string> outputs,
+              vector<string> clobbers, vector<string> lines)
+        : inputs(inputs), outputs(outputs), clobbers(clobbers), lines(lines) {}
+
+    string generateAssembly(CodeGenerator& generator) override {
+        for (const auto& name : inputs) {
+            requireWord(generator, name);
+        }
+        for (const auto& name : outputs) {
+            requireWord(generator, name);
+        }
+
+        map<string, string> operands;
+        for (const auto& name : inputs) {
+            string reg = allocateRegister(generator);
+            const string& location = generator.accessVariableLocation(name);
+            generator.emit("LDR " + reg + ", [" + location + "]");
+            operands[name] = reg;
+        }
+        for (const auto& name : outputs) {
+            if (operands.find(name) == operands.end()) {
+                operands[name] = allocateRegister(generator);
+            }
+        }
+
+        for (const auto& line : lines) {
+            generator.emit(substituteOperands(line, operands));
+        }
+        generator.invalidateConstantRegisters();
+
+        for (const auto& name : outputs) {
+            const string& location = generator.accessVariableLocation(name);
+            generator.emit("STR " + operands[name] + ", [" + location + "]");
+        }
+        return "";
+    }
+
+private:
+    static void requireWord(CodeGenerator& generator, const string& name) {
+        if (generator.isFlag(name)) {
+            throw runtime_error("asm operand '" + name + "' must be an int");
+        }
+    }
+
+    string allocateRegister(CodeGenerator& generator) {
+        string reg;
+        do {
+            reg = generator.getNewRegister();
+        } while (find(clobbers.begin(), clobbers.end(), reg) != clobbers.end());
+        return reg;
+    }
+
+    static string substituteOperands(const string& line, const map<string, string>& operands) {
+        string result;
+        size_t pos = 0;
+        while (pos < line.length()) {
+            size_t open = line.find('{', pos);
+            if (open == string::npos) {
+                break;
+            }
+            size_t close = line.find('}', open);
+            string name = close == string::npos ? "" : line.substr(open + 1, close - open - 1);
+            auto it = operands.find(name);
+            if (it == operands.end()) {
+                if (isOperandName(name) && !isRegisterName(name)) {
+                    throw runtime_error("asm line '" + line + "' uses '{" + name +
+                                        "}', which is not an in or out operand");
+                }
+                // Not an operand, e.g. a register list: keep the brace
+                result += line.substr(pos, open + 1 - pos);
+                pos = open + 1;
+                continue;
+            }
+            result += line.substr(pos, open - pos) + it->second;
+            pos = close + 1;
+        }
+        return result + line.substr(pos);
+    }
+
+    // A variable or field name such as "x" or "p.x".
+    static bool isOperandName(const string& text) {
+        bool start = true;
+        for (char c : text) {
+            if (start ? !(isalpha(c) || c == '_') : !(isalnum(c) || c == '_' || c == '.')) {
+                return false;
+            }
+            start = c == '.';
+        }
+        return !start;
+    }
+
+    // A single-register list such as "{R4}" or "{lr}".
+    static bool isRegisterName(const string& text) {
+        string name;
+        for (char c : text) {
+            name += static_cast<char>(toupper(c));
+        }
+        if (name == "SP" || name == "LR" || name == "PC") {
+            return true;
+        }
+        if (name.length() < 2 || name.length() > 3 || name[0] != 'R' ||
+            !isdigit(name[1]) || (name.length() == 3 && (name[1] != '1' || !isdigit(name[2])))) {
+            return false;
+        }
+        return stoi(name.substr(1)) <= 15;
+    }
+};
+
 // Parser Class
 class Parser {
 private:
-    vector<Token> tokens;
-    size_t current = 0;
+    Lexer lexer;
+    // A three-token window over the lexer: the token just consumed, the
+    // current one, and one more of lookahead for the reserved-name check.
+    Token previous;
+    Token current{TokenType::TOKEN_EOF};
+    Token next{TokenType::TOKEN_EOF};
+    set<string> structNames;
 
-    Token peek() {
-        if (current >= tokens.size()) return Token(TokenType::TOKEN_EOF, "");
-        return tokens[current];
+    // Tokens are handed out by reference so the hot peek/match loop does
+    // not copy the token text on every lookahead. The window stops
+    // sliding once the current token is TOKEN_EOF.
+    const Token& peek() const {
+        return current;
+    }
+
+    const Token& advance() {
+        if (current.type == TokenType::TOKEN_EOF) {
+            return current;
+        }
+        previous = move(current);
+        current = move(next);
+        next = current.type == TokenType::TOKEN_EOF ? current : lexer.getNextToken();
+        checkReserved();
+        return previous;
+    }
+
+    // Names starting with "_" belong to the compiler (_start,
+    // __bss_start, __flagsN, ...); only intrinsic calls may use them.
+    void checkReserved() const {
+        const string& text = current.text;
+        if (current.type == TokenType::TOKEN_IDENTIFIER && text[0] == '_' &&
+            !(next.type == TokenType::TOKEN_LPAREN && Intrinsic::arity(text) >= 0)) {
+            throw runtime_error("Identifier '" + text +
+                                "' is reserved: names starting with '_' belong to the compiler");
+        }
     }
 
-    Token advance() {
-        if (current >= tokens.size()) return Token(TokenType::TOKEN_EOF, "");
-        return tokens[current++];
+    // Detaches the source; parseNext() keeps returning nullptr.
+    void end() {
+        lexer = Lexer();
+        previous = current = next = Token(TokenType::TOKEN_EOF);
     }
 
     bool match(TokenType type) {
@@ -368,11 +1245,15 @@ private:
 
     Expression* parsePrimary() {
         if (match(TokenType::TOKEN_NUMBER)) {
-            return new Number(stoi(tokens[current - 1].text));
+            return new Number(stoi(previous.text));
         }
         
         if (match(TokenType::TOKEN_IDENTIFIER)) {
-            return new Identifier(tokens[current - 1].text);
+            string name = previous.text;
+            if (match(TokenType::TOKEN_LPAREN)) {
+                return parseIntrinsic(name);
+            }
+            return new Identifier(parseMemberAccess(name));
         }
         
         if (match(TokenType::TOKEN_LPAREN)) {
@@ -387,26 +1268,80 @@ private:
         throw runtime_error("Expected expression");
     }
 
+    Expression* parseIntrinsic(const string& name) {
+        int arity = Intrinsic::arity(name);
+        if (arity < 0) {
+            throw runtime_error("Unknown function '" + name + "'");
+        }
+        
+        vector<Expression*> args;
+        try {
+            if (!match(TokenType::TOKEN_RPAREN)) {
+                do {
+                    args.push_back(parseExpression());
+                } while (match(TokenType::TOKEN_COMMA));
+                if (!match(TokenType::TOKEN_RPAREN)) {
+                    throw runtime_error("Expected ')'");
+                }
+            }
+            if (static_cast<int>(args.size()) != arity) {
+                throw runtime_error(name + " takes " + to_string(arity) + " arguments");
+            }
+            // Anything that sets flags would replace the carry __adc reads
+            if (name == "__adc") {
+                for (auto arg : args) {
+                    if (arg->setsFlags()) {
+                        throw runtime_error("Arguments of __adc must not set flags");
+                    }
+                }
+            }
+        } catch (...) {
+            for (auto arg : args) {
+                delete arg;
+            }
+            throw;
+        }
+        return new Intrinsic(name, args);
+    }
+
     Statement* parseStatement() {
         if (match(TokenType::TOKEN_INT)) {
-            return parseVarDeclaration();
+            return parseVarDeclaration("int");
+        }
+        if (match(TokenType::TOKEN_BOOL)) {
+            return parseVarDeclaration("bool");
+        }
+        if (match(TokenType::TOKEN_STRUCT)) {
+            return parseStructDeclaration();
+        }
+        if (peek().type == TokenType::TOKEN_IDENTIFIER &&
+            structNames.find(peek().text) != structNames.end()) {
+            string type = advance().text;
+            return parseVarDeclaration(type);
         }
         if (match(TokenType::TOKEN_IF)) {
             return parseIf();
         }
+        if (match(TokenType::TOKEN_ASM)) {
+            return parseInlineAsm();
+        }
         if (peek().type == TokenType::TOKEN_IDENTIFIER) {
             return parseAssignment();
         }
         throw runtime_error("Expected statement");
     }
 
-    Statement* parseVarDeclaration() {
+    Statement* parseVarDeclaration(const string& type) {
         if (!match(TokenType::TOKEN_IDENTIFIER)) {
-            throw runtime_error("Expected identifier after 'int'");
+            throw runtime_error("Expected identifier after '" + type + "'");
         }
-        string name = tokens[current - 1].text;
+        string name = previous.text;
         
         Expression* init = nullptr;
+        if (structNames.find(type) != structNames.end() &&
+            peek().type == TokenType::TOKEN_ASSIGN) {
+            throw runtime_error("Struct variables cannot be initialised");
+        }
         if (match(TokenType::TOKEN_ASSIGN)) {
             init = parseExpression();
         }
@@ -416,11 +1351,11 @@ private:
             throw runtime_error("Expected ';'");
         }
         
-        return new VarDeclaration("int", name, init);
+        return new VarDeclaration(type, name, init);
     }
 
     Statement* parseAssignment() {
-        string name = advance().text;
+        string name = parseMemberAccess(advance().text);
         
         if (!match(TokenType::TOKEN_ASSIGN)) {
             throw runtime_error("Expected '='");
@@ -436,6 +1371,59 @@ private:
         return new Assignment(name, value);
     }
 
+    // Appends ".field" if a member access follows the name.
+    string parseMemberAccess(string name) {
+        if (match(TokenType::TOKEN_DOT)) {
+            if (!match(TokenType::TOKEN_IDENTIFIER)) {
+                throw runtime_error("Expected field name after '.'");
+            }
+            name += "." + previous.text;
+        }
+        return name;
+    }
+
+    // struct Name { int a; bool b; ... }
+    Statement* parseStructDeclaration() {
+        if (!match(TokenType::TOKEN_IDENTIFIER)) {
+            throw runtime_error("Expected struct name");
+        }
+        string name = previous.text;
+        if (!structNames.insert(name).second) {
+            throw runtime_error("Struct '" + name + "' redefined");
+        }
+        
+        if (!match(TokenType::TOKEN_LBRACE)) {
+            throw runtime_error("Expected '{'");
+        }
+        
+        vector<pair<string, string>> fields;
+        set<string> fieldNames;
+        while (!match(TokenType::TOKEN_RBRACE)) {
+            string type;
+            if (match(TokenType::TOKEN_INT)) {
+                type = "int";
+            } else if (match(TokenType::TOKEN_BOOL)) {
+                type = "bool";
+            } else {
+                throw runtime_error("Expected field type");
+            }
+            if (!match(TokenType::TOKEN_IDENTIFIER)) {
+                throw runtime_error("Expected field name");
+            }
+            string field = previous.text;
+            if (!fieldNames.insert(field).second) {
+                throw runtime_error("Duplicate field '" + field + "' in struct " + name);
+            }
+            if (!match(TokenType::TOKEN_SEMICOLON)) {
+                throw runtime_error("Expected ';'");
+            }
+            fields.emplace_back(type, field);
+        }
+        match(TokenType::TOKEN_SEMICOLON);
+        
+        return new StructDeclaration(name, fields);
+    }
+
     Statement* parseIf() {
         if (!match(TokenType::TOKEN_LPAREN)) {
             throw runtime_error("Expected '('");
@@ -461,67 +1449,258 @@ private:
         return new If(condition, body);
     }
 
+    // asm (in a, b; out c; clobber R0) { "instruction"; ... }
+    // The operand list is optional and its clauses may come in any order.
+    Statement* parseInlineAsm() {
+        vector<string> inputs, outputs, clobbers, lines;
+        
+        if (match(TokenType::TOKEN_LPAREN)) {
+            while (!match(TokenType::TOKEN_RPAREN)) {
+                if (!match(TokenType::TOKEN_IDENTIFIER)) {
+                    throw runtime_error("Expected 'in', 'out' or 'clobber'");
+                }
+                string clause = previous.text;
+                vector<string>* names = nullptr;
+                if (clause == "in") names = &inputs;
+                else if (clause == "out") names = &outputs;
+                else if (clause == "clobber") names = &clobbers;
+                else throw runtime_error("Unknown asm clause '" + clause + "'");
+                
+                do {
+                    if (!match(TokenType::TOKEN_IDENTIFIER)) {
+                        throw runtime_error("Expected name in '" + clause + "' clause");
+                    }
+                    names->push_back(parseMemberAccess(previous.text));
+                } while (match(TokenType::TOKEN_COMMA));
+                
+                if (peek().type != TokenType::TOKEN_RPAREN &&
+                    !match(TokenType::TOKEN_SEMICOLON)) {
+                    throw runtime_error("Expected ';' or ')'");
+                }
+            }
+        }
+        
+        if (!match(TokenType::TOKEN_LBRACE)) {
+            throw runtime_error("Expected '{'");
+        }
+        while (!match(TokenType::TOKEN_RBRACE)) {
+            if (!match(TokenType::TOKEN_STRING)) {
+                throw runtime_error("Expected assembly string");
+            }
+            lines.push_back(previous.text);
+            match(TokenType::TOKEN_SEMICOLON);
+        }
+        
+        return new InlineAsm(inputs, outputs, clobbers, lines);
+    }
+
 public:
     Block* parse(const string& input) {
-        // Tokenize input
-        Lexer lexer(input);
-        Token token;
-        do {
-            token = lexer.getNextToken();
-            tokens.push_back(token);
-        } while (token.type != TokenType::TOKEN_EOF);
-        
-        // Parse tokens
+        istringstream source(input);
+        begin(source);
         Block* program = new Block();
-        while (peek().type != TokenType::TOKEN_EOF) {
-            program->addStatement(parseStatement());
+        try {
+            while (Statement* stmt = parseNext()) {
+                program->addStatement(stmt);
+            }
+        } catch (...) {
+            delete program;
+            end();
+            throw;
         }
         return program;
     }
+
+    // Incremental interface: begin() attaches the source, which must
+    // outlive the parse, then each parseNext() call lexes and returns one
+    // top-level statement, or nullptr at end of input.
+    void begin(istream& input) {
+        lexer = Lexer(input.rdbuf());
+        previous = Token();
+        current = lexer.getNextToken();
+        next = current.type == TokenType::TOKEN_EOF ? current : lexer.getNextToken();
+        checkReserved();
+    }
+
+    Statement* parseNext() {
+        if (current.type != TokenType::TOKEN_EOF) {
+            return parseStatement();
+        }
+        end();
+        return nullptr;
+    }
+
 };
 
-int main() {
+// CompileStats Class
+// Per-run counters, printed to stdout in the Prometheus text format so
+// a textfile collector can scrape them from a build job.
+class CompileStats {
+public:
+    size_t bytesIn = 0;
+    size_t bytesOut = 0;
+    size_t statements = 0;
+    size_t peakBuffered = 0;
+    size_t spills = 0;
+    double parseSeconds = 0;
+    double codegenSeconds = 0;
+    double writeSeconds = 0;
+    // Phases are only timed when the stats will be printed, keeping the
+    // clock reads out of the per-statement loop otherwise.
+    bool timed = false;
+
+    void startPhase() {
+        if (timed) {
+            phaseStart = chrono::steady_clock::now();
+        }
+    }
+
+    void endPhase(double& seconds) {
+        if (timed) {
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - phaseStart).count();
+        }
+    }
+
+    void print(ostream& out) const {
+        printMetric(out, "simplelang_input_bytes", "gauge", bytesIn);
+        printMetric(out, "simplelang_output_bytes", "gauge", bytesOut);
+        printMetric(out, "simplelang_statements", "gauge", statements);
+        printMetric(out, "simplelang_buffer_peak_bytes", "gauge", peakBuffered);
+        printMetric(out, "simplelang_spills", "gauge", spills);
+        out << "# TYPE simplelang_phase_seconds gauge\n";
+        out << "simplelang_phase_seconds{phase=\"parse\"} " << parseSeconds << "\n";
+        out << "simplelang_phase_seconds{phase=\"codegen\"} " << codegenSeconds << "\n";
+        out << "simplelang_phase_seconds{phase=\"write\"} " << writeSeconds << "\n";
+    }
+
+private:
+    chrono::steady_clock::time_point phaseStart;
+
+    static void printMetric(ostream& out, const string& name, const string& type, size_t value) {
+        out << "# TYPE " << name << " " << type << "\n";
+        out << name << " " << value << "\n";
+    }
+};
+
+// Parses a non-negative decimal byte count given to a command-line option.
+size_t parseByteCount(const string& option, const string& value) {
+    bool valid = !value.empty();
+    for (char c : value) {
+        valid = valid && isdigit(static_cast<unsigned char>(c));
+    }
+    if (valid) {
+        try {
+            return stoul(value);
+        } catch (const out_of_range&) {
+        }
+    }
+    throw runtime_error("Invalid value for " + option + ": '" + value + "'");
+}
+
+int main(int argc, char* argv[]) {
     try {
-        // Read input file
-        ifstream input("input.txt");
+        // Bytes of generated code, and of each data section, held in memory
+        // before being spilled to disk
+        size_t memoryBudget = 64 * 1024;
+        bool printStats = false;
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--memory-budget") {
+                if (i + 1 >= argc) {
+                    throw runtime_error("--memory-budget requires a value in bytes");
+                }
+                memoryBudget = parseByteCount(arg, argv[++i]);
+            } else if (arg == "--stats") {
+                printStats = true;
+            } else {
+                throw runtime_error("Unknown option: " + arg);
+            }
+        }
+
+        CompileStats stats;
+        stats.timed = printStats;
+
+        // The lexer pulls the source through the file buffer as it parses
+        ifstream input("input.txt", ios::binary | ios::ate);
         if (!input) {
             throw runtime_error("Cannot open input.txt");
         }
-        string content((istreambuf_iterator<char>(input)),
-                      istreambuf_iterator<char>());
-        input.close();
+        // tellg() is -1 on failure and bogus for non-regular files
+        streamoff size = input.tellg();
+        if (size < 0 || static_cast<unsigned long long>(size) > string().max_size()) {
+            throw runtime_error("Cannot read input.txt");
+        }
+        input.seekg(0);
+        stats.bytesIn = static_cast<size_t>(size);
 
-        // Parse the input
-        Parser parser;
-        Block* ast = parser.parse(content);
+        // Code is spilled to a temporary file so a failed compile leaves
+        // any previous output.s untouched
+        ofstream output("output.s.tmp");
+        if (!output) {
+            throw runtime_error("Cannot create output.s");
+        }
 
         // Generate assembly
-        CodeGenerator generator;
+        CodeGenerator generator(output, memoryBudget);
         
-        // Generate code sections
+        // Generate entry point and startup code
         generator.generatePrelude();
-        generator.generatePostlude();
         
-        // Generate code from AST
-        ast->generateAssembly(generator);
+        // Parse and lower one top-level statement at a time, so only the
+        // statement being compiled is held as an AST
+        Parser parser;
+        stats.startPhase();
+        parser.begin(input);
+        stats.endPhase(stats.parseSeconds);
+        while (true) {
+            stats.startPhase();
+            Statement* stmt = parser.parseNext();
+            stats.endPhase(stats.parseSeconds);
+            if (!stmt) {
+                break;
+            }
+            stats.startPhase();
+            try {
+                stmt->generateAssembly(generator);
+            } catch (...) {
+                delete stmt;
+                throw;
+            }
+            delete stmt;
+            stats.endPhase(stats.codegenSeconds);
+            stats.statements++;
+        }
         
-        // Generate program exit
+        // Generate program exit, then the data sections
         generator.generateEpilogue();
+        generator.generatePostlude();
 
         // Save the generated assembly to output.s
-        ofstream output("output.s");
+        stats.startPhase();
+        generator.flush();
+        output.close();
         if (!output) {
+            throw runtime_error("Cannot write output.s");
+        }
+        remove("output.s");
+        if (rename("output.s.tmp", "output.s") != 0) {
             throw runtime_error("Cannot create output.s");
         }
-        output << generator.getCurrentCode();
-        output.close();
+        stats.endPhase(stats.writeSeconds);
 
-        cout << "Assembly code has been generated and saved to output.s" << endl;
+        // With --stats, stdout carries only the metrics so it can be
+        // redirected straight into a textfile collector
+        (printStats ? cerr : cout) << "Assembly code has been generated and saved to output.s\n";
 
-        // Clean up
-        delete ast;
+        if (printStats) {
+            stats.bytesOut = generator.getBytesEmitted();
+            stats.peakBuffered = generator.getPeakBuffered();
+            stats.spills = generator.getSpillCount();
+            stats.print(cout);
+        }
 
     } catch (const exception& ex) {
+        remove("output.s.tmp");
         cerr << "Error: " << ex.what() << '\n';
         return 1;
     }
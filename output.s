@@ -1,22 +1,25 @@
-.section .data
 .section .text
 .global _start
 _start:
-x: .word 0
-MOV R0, #5
-STR R0, [x]
-LDR R1, [x]
-MOV R2, #5
-CMP R1, R2
-MOV R3, #0
-MOVEQ R3, #1
-CMP R3, #1
+LDR R0, =__bss_start
+LDR R1, =__bss_end
+MOV R2, #0
+__bss_clear:
+CMP R0, R1
+STRLO R2, [R0], #4
+BLO __bss_clear
+LDR R0, [x]
+CMP R0, #5
 BNE L0
-LDR R4, [x]
-MOV R5, #1
-ADD R6, R4, R5
-STR R6, [x]
+LDR R1, [x]
+ADD R2, R1, #1
+STR R2, [x]
 L0:
 MOV R7, #1
 MOV R0, #0
 SWI 0
+.section .data
+x: .word 5
+.section .bss
+__bss_start:
+__bss_end:
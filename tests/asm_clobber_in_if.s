@@ -0,0 +1,28 @@
+.section .text
+.global _start
+_start:
+LDR R0, =__bss_start
+LDR R1, =__bss_end
+MOV R2, #0
+__bss_clear:
+CMP R0, R1
+STRLO R2, [R0], #4
+BLO __bss_clear
+MOV R0, #7
+STR R0, [b]
+LDR R1, [b]
+CMP R1, #7
+BNE L0
+MOV R1, #99
+L0:
+MOV R2, #7
+STR R2, [c]
+MOV R7, #1
+MOV R0, #0
+SWI 0
+.section .data
+.section .bss
+__bss_start:
+b: .space 4
+c: .space 4
+__bss_end:
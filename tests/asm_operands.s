@@ -0,0 +1,31 @@
+.section .text
+.global _start
+_start:
+LDR R0, =__bss_start
+LDR R1, =__bss_end
+MOV R2, #0
+__bss_clear:
+CMP R0, R1
+STRLO R2, [R0], #4
+BLO __bss_clear
+LDR R1, [a]
+LDR R3, [b]
+PUSH {R0, R2}
+MOV R0, R1
+ADD R4, R1, R3
+POP {R0, R2}
+STR R4, [sum]
+LDR R5, [sum]
+ADD R5, R5, #1
+STR R5, [sum]
+NOP
+MOV R7, #1
+MOV R0, #0
+SWI 0
+.section .data
+a: .word 5
+.section .bss
+__bss_start:
+b: .space 4
+sum: .space 4
+__bss_end:
@@ -0,0 +1,61 @@
+.section .text
+.global _start
+_start:
+LDR R0, =__bss_start
+LDR R1, =__bss_end
+MOV R2, #0
+__bss_clear:
+CMP R0, R1
+STRLO R2, [R0], #4
+BLO __bss_clear
+LDRB R0, [__flags1]
+ORR R0, R0, #1
+STRB R0, [__flags1]
+LDRB R1, [__flags0]
+ORR R1, R1, #128
+STRB R1, [__flags0]
+LDRB R2, [__flags0]
+BIC R2, R2, #2
+STRB R2, [__flags0]
+LDR R3, [x]
+CMP R3, #3
+MOV R4, #0
+MOVEQ R4, #1
+CMP R4, #0
+LDRB R5, [__flags1]
+ORRNE R5, R5, #1
+BICEQ R5, R5, #1
+STRB R5, [__flags1]
+LDRB R6, [__flags1]
+TST R6, #1
+BEQ L0
+LDRB R7, [__flags0]
+AND R8, R7, #128
+LSR R9, R8, #7
+LDRB R10, [__flags0]
+AND R11, R10, #1
+ADD R12, R9, R11
+STR R12, [x]
+L0:
+LDRB R13, [__flags0]
+TST R13, #1
+BEQ L1
+LDRB R14, [__flags1]
+AND R15, R14, #1
+CMP R15, #0
+LDRB R16, [__flags0]
+ORRNE R16, R16, #4
+BICEQ R16, R16, #4
+STRB R16, [__flags0]
+L1:
+MOV R7, #1
+MOV R0, #0
+SWI 0
+.section .data
+.section .bss
+__bss_start:
+x: .space 4
+__flags0: .space 1
+__flags1: .space 1
+.balign 4
+__bss_end:
@@ -0,0 +1,60 @@
+.section .text
+.global _start
+_start:
+LDR R0, =__bss_start
+LDR R1, =__bss_end
+MOV R2, #0
+__bss_clear:
+CMP R0, R1
+STRLO R2, [R0], #4
+BLO __bss_clear
+LDR R0, [x]
+LDR R1, [y]
+ADDS R2, R0, R1
+STR R2, [lo]
+LDR R3, [x]
+ADC R4, R3, #0
+STR R4, [hi]
+LDR R5, [hi]
+LDR R6, [hi]
+ADC R7, R5, R6
+STR R7, [carry]
+LDR R8, [y]
+ROR R9, R8, #8
+STR R9, [x]
+LDR R10, [y]
+ROR R11, R10, #28
+STR R11, [x]
+LDR R12, [x]
+ORR R13, R12, #2147483648
+STR R13, [x]
+LDR R14, [x]
+BIC R15, R14, #1
+STR R15, [x]
+LDR R16, [x]
+TST R16, #8
+MOV R17, #0
+MOVNE R17, #1
+STR R17, [y]
+LDR R18, [x]
+TST R18, #32
+BEQ L0
+MOV R19, #1
+STR R19, [y]
+L0:
+MOV R20, #-2147483632
+STR R20, [x]
+LDR R21, =100001
+STR R21, [y]
+MOV R7, #1
+MOV R0, #0
+SWI 0
+.section .data
+.section .bss
+__bss_start:
+lo: .space 4
+x: .space 4
+y: .space 4
+hi: .space 4
+carry: .space 4
+__bss_end:
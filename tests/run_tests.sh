@@ -0,0 +1,34 @@
+#!/bin/sh
+# Compiles every tests/NAME.txt and compares the result with its golden
+# file: NAME.s for the generated assembly, or NAME.err for the error a
+# rejected program must report.
+set -u
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+${CXX:-g++} -std=c++11 -Wall -Wextra -O2 -o "$work/final_cp" "$root/final_cp.cpp" || exit 1
+
+failed=0
+for source in "$root"/tests/*.txt; do
+    name=$(basename "$source" .txt)
+    cp "$source" "$work/input.txt"
+    rm -f "$work/output.s"
+    (cd "$work" && ./final_cp > /dev/null 2> stderr.txt)
+    status=$?
+    if [ -f "$root/tests/$name.err" ]; then
+        if [ $status -eq 0 ] || ! diff -u "$root/tests/$name.err" "$work/stderr.txt"; then
+            echo "FAIL $name"
+            failed=1
+            continue
+        fi
+    elif [ $status -ne 0 ] || ! diff -u "$root/tests/$name.s" "$work/output.s"; then
+        cat "$work/stderr.txt"
+        echo "FAIL $name"
+        failed=1
+        continue
+    fi
+    echo "ok   $name"
+done
+exit $failed
@@ -0,0 +1,47 @@
+.section .text
+.global _start
+_start:
+LDR R0, =__bss_start
+LDR R1, =__bss_end
+MOV R2, #0
+__bss_clear:
+CMP R0, R1
+STRLO R2, [R0], #4
+BLO __bss_clear
+MOV R0, #1
+STR R0, [n.hot]
+LDR R1, [n.hot]
+LDR R2, [n.warm]
+ADD R3, R1, R2
+STR R3, [n.hot]
+LDRB R4, [n.__flags0]
+ORR R4, R4, #2
+STRB R4, [n.__flags0]
+LDRB R5, [n.__flags0]
+TST R5, #1
+BEQ L0
+MOV R6, #2
+STR R6, [n.hot]
+L0:
+LDR R7, [n.warm]
+ADD R7, R7, #1
+STR R7, [n.warm]
+LDR R8, [n.hot]
+STR R8, [spare.cold]
+MOV R7, #1
+MOV R0, #0
+SWI 0
+.section .data
+.section .bss
+__bss_start:
+n: .space 16
+.equ n.__flags0, n + 12
+.equ n.cold, n + 8
+.equ n.hot, n + 0
+.equ n.warm, n + 4
+spare: .space 16
+.equ spare.__flags0, spare + 12
+.equ spare.cold, spare + 8
+.equ spare.hot, spare + 0
+.equ spare.warm, spare + 4
+__bss_end: